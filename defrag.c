@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "simfs.h"
+#include "libsimfs.h"
+
+
+/* Wait until everything written so far is on disk.  The defragmenter
+ * relies on this to order its writes.
+ */
+
+static void
+syncfs(simfs *fs) {
+    int err = simfs_flush(fs);
+    if (err != SIMFS_OK) {
+        fprintf(stderr, "Error: %s\n", simfs_strerror(err));
+        exit(1);
+    }
+}
+
+/* Write the metadata back, waiting until it is on disk. */
+
+static void
+putmeta(simfs *fs, fentry *files, fnode *fnodes) {
+    if (simfs_putmeta(fs, files, fnodes) != SIMFS_OK) {
+        fprintf(stderr, "Error: write-back of metadata failed in defrag\n");
+        exit(1);
+    }
+}
+
+/* Rearrange the file system in the file specified by filename so that
+ * each file's blocks are physically contiguous.  A fragmented file is
+ * moved to the lowest run of free blocks that can hold all of it.  No
+ * more than maxblocks blocks are moved; a negative maxblocks means no
+ * limit.
+ *
+ * Each file is moved in steps, with the image synced to disk after each
+ * one.  First the data is copied into the new run.  Then the new run's
+ * fnodes are marked in use and linked, while the old chain stays intact;
+ * until the next step fsck sees them only as leaked blocks.  Then the
+ * fentry is pointed at the new run.  Last, the old fnodes are freed; their
+ * blocks are cleared when they are next allocated.  A crash at any point
+ * therefore leaves the file readable from either its old or its new
+ * location.
+ */
+
+int
+defrag(char *filename, int maxblocks) {
+    fentry files[MAXFILES];
+    fnode fnodes[MAXBLOCKS];
+    char block[BLOCKSIZE];
+    simfs *fs;
+    int moved = 0;
+    int err;
+    int i, j;
+
+    if ((err = simfs_mount(filename, &fs)) != SIMFS_OK) {
+        fprintf(stderr, "Error: %s\n", simfs_strerror(err));
+        exit(1);
+    }
+    simfs_getmeta(fs, files, fnodes);
+
+    for (i = 0; i < MAXFILES; i++) {
+        if (files[i].name[0] == '\0' || files[i].firstblock == -1) {
+            continue;
+        }
+        int nodes_in_file;
+        int *file_nodes = existingNodeCollector(files, fnodes, i, &nodes_in_file);
+
+        /* A fragment is a maximal run of physically consecutive blocks. */
+        int fragments = 1;
+        for (j = 1; j < nodes_in_file; j++) {
+            if (file_nodes[j] != file_nodes[j - 1] + 1) {
+                fragments++;
+            }
+        }
+        printf("file \"%s\": %d blocks in %d fragments\n",
+               files[i].name, nodes_in_file, fragments);
+        if (fragments == 1) {
+            free(file_nodes);
+            continue;
+        }
+        if (maxblocks >= 0 && moved + nodes_in_file > maxblocks) {
+            printf("file \"%s\": skipped, move limit reached\n", files[i].name);
+            free(file_nodes);
+            continue;
+        }
+        int target = simfs_findfreerun(fnodes, nodes_in_file);
+        if (target == -1) {
+            printf("file \"%s\": skipped, no free run of %d blocks\n",
+                   files[i].name, nodes_in_file);
+            free(file_nodes);
+            continue;
+        }
+
+        /* Step 1: copy the data into the new run. */
+        for (j = 0; j < nodes_in_file; j++) {
+            if (simfs_readblock(fs, file_nodes[j], block) != SIMFS_OK) {
+                fprintf(stderr, "Error: could not read data block\n");
+                exit(1);
+            }
+            if (simfs_writeblock(fs, target + j, block) != SIMFS_OK) {
+                fprintf(stderr, "Error: could not write data block\n");
+                exit(1);
+            }
+        }
+        syncfs(fs);
+
+        /* Step 2: link up the new run, keeping the file's holes. */
+        for (j = 0; j < nodes_in_file; j++) {
+            int holes = LINKHOLES(fnodes[file_nodes[j]].nextblock);
+            fnodes[target + j].blockindex = target + j;
+            fnodes[target + j].nextblock = j == nodes_in_file - 1 ? -1 : CHAINLINK(target + j + 1, holes);
+        }
+        putmeta(fs, files, fnodes);
+
+        /* Step 3: switch the file over to the new run. */
+        files[i].firstblock = CHAINLINK(target, LINKHOLES(files[i].firstblock));
+        files[i].lastblock = target + nodes_in_file - 1;
+        putmeta(fs, files, fnodes);
+
+        /* Step 4: free the old blocks. */
+        for (j = 0; j < nodes_in_file; j++) {
+            fnodes[file_nodes[j]].blockindex = -file_nodes[j];
+            fnodes[file_nodes[j]].nextblock = -1;
+        }
+        putmeta(fs, files, fnodes);
+
+        printf("file \"%s\": moved to blocks %d-%d\n",
+               files[i].name, target, target + nodes_in_file - 1);
+        moved += nodes_in_file;
+        free(file_nodes);
+    }
+
+    printf("%s: %d blocks moved\n", filename, moved);
+    simfs_unmount(fs);
+    return 0;
+}
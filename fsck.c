@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "simfs.h"
+#include "libsimfs.h"
+
+
+/* Check the consistency of the file system in the file specified by
+ * filename.  Every problem found is reported on standard output.  If
+ * repair is non-zero the metadata is rewritten so that the file system
+ * is consistent again: bad chains are truncated at the first bad link,
+ * and leaked blocks are returned to the free list.
+ *
+ * Returns 0 if the file system is consistent (or has been repaired),
+ * and 1 otherwise.
+ */
+
+int
+fsck(char *filename, int repair) {
+    fentry files[MAXFILES];
+    fnode fnodes[MAXBLOCKS];
+    int owner[MAXBLOCKS];       /* fentry index owning each block, or -1 */
+    simfs *fs;
+    int problems = 0;
+    int err;
+    int i;
+
+    if ((err = simfs_mount(filename, &fs)) != SIMFS_OK) {
+        fprintf(stderr, "Error: %s\n", simfs_strerror(err));
+        exit(1);
+    }
+    simfs_getmeta(fs, files, fnodes);
+
+    /* Pass 1: the block table itself.  Each fnode must describe its own
+     * block, and the blocks holding the metadata must be in use.
+     */
+    for (i = 0; i < MAXBLOCKS; i++) {
+        owner[i] = -1;
+        if (fnodes[i].blockindex != i && fnodes[i].blockindex != -i) {
+            printf("block %d: blockindex is %hd\n", i, fnodes[i].blockindex);
+            problems++;
+            fnodes[i].blockindex = fnodes[i].blockindex < 0 ? -i : i;
+        }
+        if (i < SIMFS_METABLOCKS && fnodes[i].blockindex < 0) {
+            printf("block %d: metadata block marked free\n", i);
+            problems++;
+            fnodes[i].blockindex = i;
+        }
+        if (fnodes[i].blockindex < 0 && fnodes[i].nextblock != -1) {
+            printf("block %d: free block links to %hd\n", i,
+                   fnodes[i].nextblock);
+            problems++;
+            fnodes[i].nextblock = -1;
+        }
+    }
+
+    /* Pass 2: walk every file's chain.  A chain ends at the first link
+     * that leaves the data area, points at a free block, revisits a block
+     * of the same file (a cycle) or a block owned by an earlier file (a
+     * cross link).
+     */
+    for (i = 0; i < MAXFILES; i++) {
+        if (files[i].name[0] == '\0') {
+            if (files[i].size != 0 || files[i].firstblock != -1 ||
+                files[i].lastblock != -1 || files[i].parent != -1 ||
+                files[i].mode != FT_FILE) {
+                printf("fentry %d: unused entry has size %hu, firstblock %hd\n",
+                       i, files[i].size, files[i].firstblock);
+                problems++;
+                memset(files[i].name, 0, sizeof(files[i].name));
+                files[i].size = 0;
+                files[i].firstblock = -1;
+                files[i].lastblock = -1;
+                files[i].parent = -1;
+                files[i].mode = FT_FILE;
+            }
+            continue;
+        }
+        if (memchr(files[i].name, '\0', sizeof(files[i].name)) == NULL) {
+            printf("fentry %d: name is not terminated\n", i);
+            problems++;
+            files[i].name[sizeof(files[i].name) - 1] = '\0';
+        }
+        if (files[i].mode != FT_FILE && files[i].mode != FT_DIR) {
+            printf("\"%s\": unknown mode %hd\n", files[i].name, files[i].mode);
+            problems++;
+            files[i].mode = FT_FILE;
+        }
+
+        /* The parent must be an existing directory, and following parents
+         * upwards must reach the root.  Entries that fail either test are
+         * moved to the root.
+         */
+        int up = files[i].parent;
+        int steps = 0;
+        while (up >= 0 && up < MAXFILES && files[up].name[0] != '\0' &&
+               files[up].mode == FT_DIR && steps < MAXFILES) {
+            up = files[up].parent;
+            steps++;
+        }
+        if (up != -1) {
+            printf("\"%s\": parent %hd is not a directory on a path to the root\n",
+                   files[i].name, files[i].parent);
+            problems++;
+            files[i].parent = -1;
+        }
+        if (files[i].mode == FT_DIR && files[i].size != 0) {
+            printf("directory \"%s\": has size %hu\n", files[i].name, files[i].size);
+            problems++;
+            files[i].size = 0;
+        }
+
+        int expected = files[i].size / BLOCKSIZE;
+        if (files[i].size % BLOCKSIZE != 0) {
+            expected += 1;
+        }
+        int pos = -1;           // Position in the file of the current block.
+        int reached = 0;        // Blocks up to and including the last one in the chain.
+        int prev = -1;
+        int link = files[i].firstblock;
+        while (link != -1) {
+            char *fault = NULL;
+            int curr = LINKNODE(link);
+            pos += 1 + LINKHOLES(link);
+            if (curr < SIMFS_METABLOCKS || curr >= MAXBLOCKS) {
+                fault = "links outside the data area";
+            } else if (owner[curr] == i) {
+                fault = "contains a cycle";
+            } else if (owner[curr] != -1) {
+                fault = "is cross-linked with another file";
+            } else if (fnodes[curr].blockindex < 0) {
+                fault = "links to a free block";
+            } else if (pos >= expected) {
+                fault = "is longer than its size";
+            }
+            if (fault != NULL) {
+                printf("file \"%s\": chain %s at block %d\n",
+                       files[i].name, fault, curr);
+                problems++;
+                if (prev == -1) {
+                    files[i].firstblock = -1;
+                } else {
+                    fnodes[prev].nextblock = -1;
+                }
+                break;
+            }
+            owner[curr] = i;
+            reached = pos + 1;
+            prev = curr;
+            link = fnodes[curr].nextblock;
+        }
+
+        /* Holes are allowed anywhere but at the end of a file. */
+        if (reached < expected) {
+            printf("file \"%s\": chain reaches %d blocks, size %hu needs %d\n",
+                   files[i].name, reached, files[i].size, expected);
+            problems++;
+            files[i].size = reached * BLOCKSIZE;
+        }
+        if (files[i].lastblock != prev) {
+            printf("file \"%s\": lastblock is %hd, chain ends at %d\n",
+                   files[i].name, files[i].lastblock, prev);
+            problems++;
+            files[i].lastblock = prev;
+        }
+    }
+
+    /* Pass 3: in-use data blocks that no file reaches have leaked. */
+    for (i = SIMFS_METABLOCKS; i < MAXBLOCKS; i++) {
+        if (fnodes[i].blockindex > 0 && owner[i] == -1) {
+            printf("block %d: in use but not owned by any file\n", i);
+            problems++;
+            fnodes[i].blockindex = -i;
+            fnodes[i].nextblock = -1;
+        }
+    }
+
+    if (problems == 0) {
+        printf("%s: clean\n", filename);
+        simfs_unmount(fs);
+        return 0;
+    }
+    if (!repair) {
+        printf("%s: %d problems found\n", filename, problems);
+        simfs_unmount(fs);
+        return 1;
+    }
+
+    if (simfs_putmeta(fs, files, fnodes) != SIMFS_OK) {
+        fprintf(stderr, "Error: write-back of metadata failed in fsck\n");
+        exit(1);
+    }
+    printf("%s: %d problems repaired\n", filename, problems);
+    simfs_unmount(fs);
+    return 0;
+}
@@ -0,0 +1,281 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "simfs.h"
+#include "libsimfs.h"
+
+/* Copying files between a directory tree on the host and the simulated
+ * file system.  The tree is walked and every file is created and given
+ * all of its blocks up front, so consecutive files get consecutive runs
+ * of blocks.  The data itself is then copied by a pool of worker threads,
+ * each taking the next file from a shared list.  The metadata reaches the
+ * image only once, when it is unmounted at the end; if anything fails the
+ * image is left as it was.
+ */
+
+#define COPYTHREADS 4
+
+typedef struct copyjob {
+    char hostpath[PATH_MAX];
+    simfs_file *fh;
+    unsigned int size;
+} copyjob;
+
+typedef struct copypool {
+    copyjob *jobs;
+    int njobs;
+    int maxjobs;
+    int next;                   // Index of the next job to hand out.
+    int failed;
+    int importing;              // Copying into the image rather than out.
+    pthread_mutex_t lock;
+} copypool;
+
+static copyjob *
+addjob(copypool *pool)
+{
+    if(pool->njobs == pool->maxjobs){
+        pool->maxjobs = pool->maxjobs == 0 ? 16 : pool->maxjobs * 2;
+        pool->jobs = realloc(pool->jobs, sizeof(copyjob) * pool->maxjobs);
+        if(pool->jobs == NULL){
+            fprintf(stderr, "%s\n", simfs_strerror(SIMFS_ENOMEM));
+            exit(1);
+        }
+    }
+    return &pool->jobs[pool->njobs++];
+}
+
+static void
+joinpath(char *buf, const char *dir, const char *name)
+{
+    if(snprintf(buf, PATH_MAX, "%s/%s", dir, name) >= PATH_MAX){
+        fprintf(stderr, "Path too long: %s/%s\n", dir, name);
+        exit(1);
+    }
+}
+
+static void
+checkfs(int err, const char *path)
+{
+    if(err < 0){
+        fprintf(stderr, "%s: %s\n", path, simfs_strerror(err));
+        exit(1);
+    }
+}
+
+/* Create the host directory path unless it already exists. */
+static void
+makehostdir(const char *path)
+{
+    struct stat st;
+
+    if(mkdir(path, 0777) == 0){
+        return;
+    }
+    if(errno == EEXIST){
+        if(stat(path, &st) == 0 && S_ISDIR(st.st_mode)){
+            return;
+        }
+        errno = ENOTDIR;
+    }
+    perror(path);
+    exit(1);
+}
+
+/* Copy one file in or out of the image. */
+static int
+copyfile(copyjob *job, int importing)
+{
+    char *data = malloc(job->size > 0 ? job->size : 1);
+    int ok = 0;
+    int fd;
+
+    if(data == NULL){
+        return 0;
+    }
+    if(importing){
+        fd = open(job->hostpath, O_RDONLY);
+        ok = fd >= 0 && simfs_readfd(fd, data, job->size) == SIMFS_OK &&
+             simfs_pwrite(job->fh, data, job->size, 0) == (ssize_t)job->size;
+    }
+    else{
+        fd = open(job->hostpath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        ok = fd >= 0 && simfs_pread(job->fh, data, job->size, 0) == (ssize_t)job->size &&
+             simfs_writefd(fd, data, job->size) == SIMFS_OK;
+    }
+    if(fd >= 0 && close(fd) != 0){
+        ok = 0;
+    }
+    if(!ok){
+        fprintf(stderr, "Error copying %s\n", job->hostpath);
+    }
+    free(data);
+    return ok;
+}
+
+static void *
+copyworker(void *arg)
+{
+    copypool *pool = arg;
+    for(;;){
+        pthread_mutex_lock(&pool->lock);
+        int i = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        if(i >= pool->njobs){
+            return NULL;
+        }
+        if(!copyfile(&pool->jobs[i], pool->importing)){
+            pthread_mutex_lock(&pool->lock);
+            pool->failed = 1;
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+}
+
+/* Run every job in the pool, then close the handles. */
+static void
+runjobs(copypool *pool)
+{
+    pthread_t workers[COPYTHREADS];
+    int nworkers = 0;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    while(nworkers < COPYTHREADS && nworkers < pool->njobs){
+        if(pthread_create(&workers[nworkers], NULL, copyworker, pool) != 0){
+            break;
+        }
+        nworkers++;
+    }
+    if(nworkers == 0){
+        copyworker(pool);
+    }
+    for(int i = 0; i < nworkers; i++){
+        pthread_join(workers[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    if(pool->failed){
+        exit(1);
+    }
+    for(int i = 0; i < pool->njobs; i++){
+        simfs_close(pool->jobs[i].fh);
+    }
+    free(pool->jobs);
+}
+
+/* Create the entries of the host directory hostdir under imagedir in the
+ * image, allocating the blocks of each file and queueing its data.
+ */
+static void
+planimport(simfs *fs, copypool *pool, const char *hostdir, const char *imagedir)
+{
+    struct dirent **names;
+    char hostpath[PATH_MAX];
+    char imagepath[PATH_MAX];
+    struct stat st;
+
+    int n = scandir(hostdir, &names, NULL, alphasort);
+    if(n < 0){
+        perror(hostdir);
+        exit(1);
+    }
+    for(int i = 0; i < n; i++){
+        char *name = names[i]->d_name;
+        if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0){
+            free(names[i]);
+            continue;
+        }
+        joinpath(hostpath, hostdir, name);
+        joinpath(imagepath, imagedir, name);
+        if(lstat(hostpath, &st) != 0){
+            perror(hostpath);
+            exit(1);
+        }
+        if(S_ISDIR(st.st_mode)){
+            checkfs(simfs_mkdir(fs, imagepath), imagepath);
+            planimport(fs, pool, hostpath, imagepath);
+        }
+        else if(S_ISREG(st.st_mode)){
+            if(st.st_size > SIMFS_MAXFILESIZE){
+                checkfs(SIMFS_EFBIG, imagepath);
+            }
+            copyjob *job = addjob(pool);
+            strcpy(job->hostpath, hostpath);
+            job->size = st.st_size;
+            checkfs(simfs_create(fs, imagepath), imagepath);
+            checkfs(simfs_open(fs, imagepath, &job->fh), imagepath);
+            checkfs(simfs_reserve(job->fh, job->size), imagepath);
+        }
+        else{
+            fprintf(stderr, "Skipping %s: not a regular file\n", hostpath);
+        }
+        free(names[i]);
+    }
+    free(names);
+}
+
+/* Create the contents of the directory imagedir under hostdir on the host,
+ * queueing the data of each file.
+ */
+static void
+planexport(simfs *fs, copypool *pool, const char *imagedir, const char *hostdir)
+{
+    simfs_dirent ents[MAXFILES];
+    char hostpath[PATH_MAX];
+    char imagepath[PATH_MAX];
+
+    int n = simfs_readdir(fs, imagedir, ents, MAXFILES);
+    checkfs(n, imagedir);
+    for(int i = 0; i < n; i++){
+        joinpath(hostpath, hostdir, ents[i].name);
+        joinpath(imagepath, imagedir, ents[i].name);
+        if(ents[i].mode == FT_DIR){
+            makehostdir(hostpath);
+            planexport(fs, pool, imagepath, hostpath);
+        }
+        else{
+            copyjob *job = addjob(pool);
+            strcpy(job->hostpath, hostpath);
+            job->size = ents[i].size;
+            checkfs(simfs_open(fs, imagepath, &job->fh), imagepath);
+        }
+    }
+}
+
+/* Copy the directory tree at hostdir into the root of the image. */
+int
+importfs(char *fsname, char *hostdir)
+{
+    copypool pool = {0};
+    simfs *fs;
+
+    pool.importing = 1;
+    checkfs(simfs_mount(fsname, &fs), fsname);
+    planimport(fs, &pool, hostdir, "");
+    runjobs(&pool);
+    checkfs(simfs_unmount(fs), fsname);
+    return 0;
+}
+
+/* Copy every file and directory in the image into hostdir, creating it if
+ * needed.
+ */
+int
+exportfs(char *fsname, char *hostdir)
+{
+    copypool pool = {0};
+    simfs *fs;
+
+    makehostdir(hostdir);
+    checkfs(simfs_mount(fsname, &fs), fsname);
+    planexport(fs, &pool, "", hostdir);
+    runjobs(&pool);
+    checkfs(simfs_unmount(fs), fsname);
+    return 0;
+}
@@ -0,0 +1,1328 @@
+/* The implementation of libsimfs.  See libsimfs.h for the interface.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include "libsimfs.h"
+
+/* An image is one or more backing files, called members.  The metadata
+ * lives at the start of the image file itself, member 0.  Member k > 0 is
+ * the file with ".k" appended to the image name.  The data blocks are
+ * dealt out to the members in turn, layout.stripeunit blocks at a time.
+ */
+struct simfs {
+    int fds[SIMFS_MAXMEMBERS];
+    fslayout layout;
+    fentry files[MAXFILES];
+    fnode nodes[MAXBLOCKS];
+    int opens[MAXFILES];        // Number of open handles on each fentry.
+    char filedirty[MAXFILES];   // Entries changed since the last sync.
+    char nodedirty[MAXBLOCKS];
+};
+
+/* A handle remembers the last block it visited so that walking forward
+ * through the file does not restart at firstblock on every call.
+ */
+struct simfs_file {
+    simfs *fs;
+    int slot;                   // Index of the file's fentry.
+    int posblock;               // An allocated block of the file, counted from 0,
+    int posnode;                // and the image block holding it (-1 if none).
+};
+
+static const char *errors[] = {
+    "Success",
+    "Error reading or writing the file system image",
+    "No such file or directory",
+    "File already exists",
+    "Not a directory",
+    "Is a directory",
+    "Directory not empty",
+    "Filename too long",
+    "Not enough space in the file system",
+    "Invalid argument",
+    "File too large",
+    "Out of memory",
+    "File is open",
+};
+
+const char *
+simfs_strerror(int err)
+{
+    if(err > 0 || -err >= (int)(sizeof(errors) / sizeof(errors[0]))){
+        return "Unknown error";
+    }
+    return errors[-err];
+}
+
+/* Internal helper functions first.
+ */
+
+/* Read len bytes at offset off of the image.  Bytes past the end of the
+ * image read as zeros, since blocks are only written out when first used.
+ */
+static int
+readall(int fd, void *buf, size_t len, off_t off)
+{
+    char *p = buf;
+    while(len > 0){
+        ssize_t n = pread(fd, p, len, off);
+        if(n < 0){
+            return SIMFS_EIO;
+        }
+        if(n == 0){
+            memset(p, 0, len);
+            return SIMFS_OK;
+        }
+        p += n;
+        len -= n;
+        off += n;
+    }
+    return SIMFS_OK;
+}
+
+static int
+writeall(int fd, const void *buf, size_t len, off_t off)
+{
+    const char *p = buf;
+    while(len > 0){
+        ssize_t n = pwrite(fd, p, len, off);
+        if(n <= 0){
+            return SIMFS_EIO;
+        }
+        p += n;
+        len -= n;
+        off += n;
+    }
+    return SIMFS_OK;
+}
+
+/* Return the offset of a block within its member, and set *member. */
+static off_t
+blockaddr(simfs *fs, int block, int *member)
+{
+    if(block < SIMFS_METABLOCKS){
+        *member = 0;
+        return (off_t)block * BLOCKSIZE;
+    }
+    int data = block - SIMFS_METABLOCKS;
+    int unit = fs->layout.stripeunit;
+    int stripe = data / unit;
+    int row = stripe / fs->layout.members;
+    *member = stripe % fs->layout.members;
+    return (off_t)((*member == 0 ? SIMFS_METABLOCKS : 0) + row * unit + data % unit) * BLOCKSIZE;
+}
+
+static void
+membername(char *buf, size_t size, const char *image, int member)
+{
+    if(member == 0){
+        snprintf(buf, size, "%s", image);
+    }
+    else{
+        snprintf(buf, size, "%s.%d", image, member);
+    }
+}
+
+static void
+closemembers(simfs *fs, int count)
+{
+    for(int i = 0; i < count; i++){
+        close(fs->fds[i]);
+    }
+}
+
+static int
+nblocks(unsigned int size)
+{
+    return (size + BLOCKSIZE - 1) / BLOCKSIZE;
+}
+
+static int
+countfree(simfs *fs)
+{
+    int count = 0;
+    for(int i = SIMFS_METABLOCKS; i < MAXBLOCKS; i++){
+        if(fs->nodes[i].blockindex < 0){
+            count++;
+        }
+    }
+    return count;
+}
+
+/* Clear len bytes at offset off within a block. */
+static int
+zeroblock(simfs *fs, int node, int off, int len)
+{
+    char zerobuf[BLOCKSIZE] = {0};
+    int member;
+    off_t at = blockaddr(fs, node, &member) + off;
+    return writeall(fs->fds[member], zerobuf, len, at);
+}
+
+/* Mark a free block as in use.  Free blocks are not cleared, and can still
+ * hold data left by a deleted file or by an operation that failed, so the
+ * caller must write or clear every byte of the block that can be read.
+ */
+static void
+useblock(simfs *fs, int node)
+{
+    fs->nodes[node].blockindex = node;
+    fs->nodes[node].nextblock = -1;
+    fs->nodedirty[node] = 1;
+}
+
+/* Take the lowest free block off the free list.  Returns the block, or
+ * SIMFS_ENOSPC if there is none.
+ */
+static int
+allocblock(simfs *fs)
+{
+    for(int i = SIMFS_METABLOCKS; i < MAXBLOCKS; i++){
+        if(fs->nodes[i].blockindex < 0){
+            useblock(fs, i);
+            return i;
+        }
+    }
+    return SIMFS_ENOSPC;
+}
+
+/* Clear the parts of a newly allocated block, block k of its file, that a
+ * write of len bytes at offset will not cover.
+ */
+static int
+clearuncovered(simfs *fs, int node, int k, off_t offset, size_t len)
+{
+    off_t start = (off_t)k * BLOCKSIZE;
+    off_t from = offset > start ? offset - start : 0;
+    off_t to = offset + (off_t)len < start + BLOCKSIZE ? offset + (off_t)len - start : BLOCKSIZE;
+    if(from >= to){
+        return zeroblock(fs, node, 0, BLOCKSIZE);
+    }
+    if(from > 0 && zeroblock(fs, node, 0, from) != SIMFS_OK){
+        return SIMFS_EIO;
+    }
+    if(to < BLOCKSIZE && zeroblock(fs, node, to, BLOCKSIZE - to) != SIMFS_OK){
+        return SIMFS_EIO;
+    }
+    return SIMFS_OK;
+}
+
+/* Clear the part of a file's last block past its end, before the file
+ * grows over it.
+ */
+static int
+zerotail(simfs *fs, int slot)
+{
+    fentry *f = &fs->files[slot];
+    int used = f->size % BLOCKSIZE;
+    if(f->lastblock == -1 || used == 0){
+        return SIMFS_OK;
+    }
+    return zeroblock(fs, f->lastblock, used, BLOCKSIZE - used);
+}
+
+/* Link a newly allocated block onto the end of a file's chain, after the
+ * given number of holes.
+ */
+static void
+chainblock(simfs *fs, int slot, int node, int holes)
+{
+    fentry *f = &fs->files[slot];
+    if(f->lastblock == -1){
+        f->firstblock = CHAINLINK(node, holes);
+    }
+    else{
+        fs->nodes[f->lastblock].nextblock = CHAINLINK(node, holes);
+        fs->nodedirty[f->lastblock] = 1;
+    }
+    f->lastblock = node;
+    fs->filedirty[slot] = 1;
+}
+
+/* Return the fentry index of the entry called name in the directory whose
+ * fentry index is dir (-1 for the root), or -1 if there is no such entry.
+ */
+static int
+lookupentry(simfs *fs, int dir, const char *name)
+{
+    for(int i = 0; i < MAXFILES; i++){
+        if(fs->files[i].name[0] != '\0' && fs->files[i].parent == dir &&
+           strncmp(fs->files[i].name, name, sizeof(fs->files[i].name)) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Walk the directories named in path, which may start with a '/'.  On
+ * success *dirp is the fentry index of the directory holding the last
+ * component of path (-1 for the root) and *leafp points at that
+ * component, which is empty if path ends in a '/'.
+ */
+static int
+resolveparent(simfs *fs, const char *path, int *dirp, const char **leafp)
+{
+    char component[sizeof(fs->files[0].name)];
+    const char *slash;
+    int dir = -1;
+
+    while(*path == '/'){
+        path++;
+    }
+    while((slash = strchr(path, '/')) != NULL){
+        size_t len = slash - path;
+        if(len >= sizeof(component)){
+            return SIMFS_ENAMETOOLONG;
+        }
+        memcpy(component, path, len);
+        component[len] = '\0';
+        dir = lookupentry(fs, dir, component);
+        if(dir == -1){
+            return SIMFS_ENOENT;
+        }
+        if(fs->files[dir].mode != FT_DIR){
+            return SIMFS_ENOTDIR;
+        }
+        path = slash;
+        while(*path == '/'){
+            path++;
+        }
+    }
+    if(strlen(path) >= sizeof(component)){
+        return SIMFS_ENAMETOOLONG;
+    }
+    *dirp = dir;
+    *leafp = path;
+    return SIMFS_OK;
+}
+
+/* Set *slotp to the fentry index of the file or directory named by path.
+ * A path naming the root sets it to -1.
+ */
+static int
+findentry(simfs *fs, const char *path, int *slotp)
+{
+    const char *leaf;
+    int dir;
+    int err = resolveparent(fs, path, &dir, &leaf);
+    if(err != SIMFS_OK){
+        return err;
+    }
+    if(*leaf == '\0'){
+        *slotp = dir;
+        return SIMFS_OK;
+    }
+    if((*slotp = lookupentry(fs, dir, leaf)) == -1){
+        return SIMFS_ENOENT;
+    }
+    return SIMFS_OK;
+}
+
+/* Add an empty entry of the given mode at path.
+ */
+static int
+createentry(simfs *fs, const char *path, short mode)
+{
+    const char *leaf;
+    int dir;
+    int err = resolveparent(fs, path, &dir, &leaf);
+    if(err != SIMFS_OK){
+        return err;
+    }
+    if(*leaf == '\0'){
+        return SIMFS_EINVAL;
+    }
+    if(lookupentry(fs, dir, leaf) != -1){
+        return SIMFS_EEXIST;
+    }
+    for(int i = 0; i < MAXFILES; i++){
+        fentry *f = &fs->files[i];
+        if(f->name[0] == '\0'){
+            memset(f->name, 0, sizeof(f->name));
+            strncpy(f->name, leaf, sizeof(f->name) - 1);
+            f->size = 0;
+            f->firstblock = -1;
+            f->lastblock = -1;
+            f->parent = dir;
+            f->mode = mode;
+            fs->filedirty[i] = 1;
+            return SIMFS_OK;
+        }
+    }
+    return SIMFS_ENOSPC;
+}
+
+static void
+clearentry(fentry *f)
+{
+    memset(f->name, 0, sizeof(f->name));
+    f->size = 0;
+    f->firstblock = -1;
+    f->lastblock = -1;
+    f->parent = -1;
+    f->mode = FT_FILE;
+}
+
+static int
+comparedirents(const void *a, const void *b)
+{
+    const simfs_dirent *da = a;
+    const simfs_dirent *db = b;
+    return strncmp(da->name, db->name, sizeof(da->name));
+}
+
+/* Find the first allocated block of the file at or after block k.  Returns
+ * its image block and sets *posp to its position in the file, or returns
+ * -1 if nothing from block k onwards is allocated.  The last block of a
+ * file is always allocated, and is found through lastblock without
+ * walking the chain.
+ */
+static int
+seekblock(simfs_file *fh, int k, int *posp)
+{
+    fnode *nodes = fh->fs->nodes;
+    fentry *f = &fh->fs->files[fh->slot];
+    int last = nblocks(f->size) - 1;
+    int link = f->firstblock;
+    int pos = -1;
+
+    if(k > last){
+        return -1;
+    }
+    if(k == last){
+        *posp = last;
+        return f->lastblock;
+    }
+    if(fh->posnode != -1 && fh->posblock <= k){
+        if(fh->posblock == k){
+            *posp = k;
+            return fh->posnode;
+        }
+        pos = fh->posblock;
+        link = nodes[fh->posnode].nextblock;
+    }
+    while(link != -1){
+        int node = LINKNODE(link);
+        pos += 1 + LINKHOLES(link);
+        if(pos >= k){
+            fh->posblock = pos;
+            fh->posnode = node;
+            *posp = pos;
+            return node;
+        }
+        link = nodes[node].nextblock;
+    }
+    return -1;
+}
+
+/* Count the holes among blocks first to last of the file. */
+static int
+countholes(simfs_file *fh, int first, int last)
+{
+    int allocated = 0;
+    int pos;
+    int node = seekblock(fh, first, &pos);
+    while(node != -1 && pos <= last){
+        allocated++;
+        int link = fh->fs->nodes[node].nextblock;
+        if(link == -1){
+            break;
+        }
+        node = LINKNODE(link);
+        pos += 1 + LINKHOLES(link);
+    }
+    return last - first + 1 - allocated;
+}
+
+/* Allocate a block for block k of the file, a hole before its last block,
+ * and link it into the chain between its allocated neighbours.  Returns
+ * the block, or a SIMFS_E* code.
+ */
+static int
+fillhole(simfs_file *fh, int k)
+{
+    simfs *fs = fh->fs;
+    fentry *f = &fs->files[fh->slot];
+    int prev = -1;
+    int prevpos = -1;
+    int link = f->firstblock;
+
+    if(fh->posnode != -1 && fh->posblock < k){
+        prev = fh->posnode;
+        prevpos = fh->posblock;
+        link = fs->nodes[prev].nextblock;
+    }
+    while(prevpos + 1 + LINKHOLES(link) < k){
+        prev = LINKNODE(link);
+        prevpos += 1 + LINKHOLES(link);
+        link = fs->nodes[prev].nextblock;
+    }
+    int nextpos = prevpos + 1 + LINKHOLES(link);
+    int node = allocblock(fs);
+    if(node < 0){
+        return node;
+    }
+    fs->nodes[node].nextblock = CHAINLINK(LINKNODE(link), nextpos - k - 1);
+    if(prev == -1){
+        f->firstblock = CHAINLINK(node, k);
+        fs->filedirty[fh->slot] = 1;
+    }
+    else{
+        fs->nodes[prev].nextblock = CHAINLINK(node, k - prevpos - 1);
+        fs->nodedirty[prev] = 1;
+    }
+    return node;
+}
+
+/* Whole images.
+ */
+
+/* Create an image whose data blocks are striped over the given number of
+ * members, stripeunit blocks at a time.  Existing members are overwritten.
+ */
+int
+simfs_format(const char *image, int members, int stripeunit)
+{
+    fentry files[MAXFILES];
+    fnode nodes[MAXBLOCKS];
+    fslayout layout;
+    char zerobuf[BLOCKSIZE] = {0};
+    char name[4096];
+    int i;
+
+    if(members < 1 || members > SIMFS_MAXMEMBERS || stripeunit < 1 ||
+       stripeunit > MAXBLOCKS){
+        return SIMFS_EINVAL;
+    }
+    for(i = 0; i < MAXFILES; i++){
+        clearentry(&files[i]);
+    }
+    for(i = 0; i < MAXBLOCKS; i++){
+        nodes[i].blockindex = i < SIMFS_METABLOCKS ? i : -i;
+        nodes[i].nextblock = -1;
+    }
+    layout.members = members;
+    layout.stripeunit = stripeunit;
+
+    for(i = members - 1; i >= 0; i--){
+        membername(name, sizeof(name), image, i);
+        int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if(fd < 0){
+            return SIMFS_EIO;
+        }
+        if(i == 0 &&
+           (writeall(fd, files, sizeof(files), 0) != SIMFS_OK ||
+            writeall(fd, nodes, sizeof(nodes), sizeof(files)) != SIMFS_OK ||
+            writeall(fd, &layout, sizeof(layout), sizeof(files) + sizeof(nodes)) != SIMFS_OK ||
+            writeall(fd, zerobuf, SIMFS_METABLOCKS * BLOCKSIZE - SIMFS_METABYTES, SIMFS_METABYTES) != SIMFS_OK)){
+            close(fd);
+            return SIMFS_EIO;
+        }
+        if(close(fd) != 0){
+            return SIMFS_EIO;
+        }
+    }
+    return SIMFS_OK;
+}
+
+int
+simfs_mount(const char *image, simfs **fsp)
+{
+    struct stat st;
+    char name[4096];
+    int fd;
+
+    simfs *fs = calloc(1, sizeof(simfs));
+    if(fs == NULL){
+        return SIMFS_ENOMEM;
+    }
+    if((fd = open(image, O_RDWR)) < 0){
+        free(fs);
+        return SIMFS_EIO;
+    }
+    fs->fds[0] = fd;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)SIMFS_METABYTES){
+        closemembers(fs, 1);
+        free(fs);
+        return SIMFS_EINVAL;
+    }
+    if(readall(fd, fs->files, sizeof(fs->files), 0) != SIMFS_OK ||
+       readall(fd, fs->nodes, sizeof(fs->nodes), sizeof(fs->files)) != SIMFS_OK ||
+       readall(fd, &fs->layout, sizeof(fs->layout), sizeof(fs->files) + sizeof(fs->nodes)) != SIMFS_OK){
+        closemembers(fs, 1);
+        free(fs);
+        return SIMFS_EIO;
+    }
+    if(fs->layout.members < 1 || fs->layout.members > SIMFS_MAXMEMBERS ||
+       fs->layout.stripeunit < 1){
+        closemembers(fs, 1);
+        free(fs);
+        return SIMFS_EINVAL;
+    }
+    for(int i = 1; i < fs->layout.members; i++){
+        membername(name, sizeof(name), image, i);
+        if((fs->fds[i] = open(name, O_RDWR)) < 0){
+            closemembers(fs, i);
+            free(fs);
+            return SIMFS_EIO;
+        }
+    }
+    *fsp = fs;
+    return SIMFS_OK;
+}
+
+/* Write back each run of changed entries in one of the metadata tables,
+ * which starts at offset base in the image.
+ */
+static int
+syncrecords(simfs *fs, char *dirty, const void *table, size_t recsize, int count, off_t base)
+{
+    int i = 0;
+    while(i < count){
+        if(!dirty[i]){
+            i++;
+            continue;
+        }
+        int start = i;
+        while(i < count && dirty[i]){
+            dirty[i++] = 0;
+        }
+        if(writeall(fs->fds[0], (const char *)table + recsize * start,
+                    recsize * (i - start), base + recsize * start) != SIMFS_OK){
+            return SIMFS_EIO;
+        }
+    }
+    return SIMFS_OK;
+}
+
+/* Write back the fentries and fnodes changed since the last sync. */
+int
+simfs_sync(simfs *fs)
+{
+    if(syncrecords(fs, fs->filedirty, fs->files, sizeof(fentry), MAXFILES, 0) != SIMFS_OK ||
+       syncrecords(fs, fs->nodedirty, fs->nodes, sizeof(fnode), MAXBLOCKS, sizeof(fs->files)) != SIMFS_OK){
+        return SIMFS_EIO;
+    }
+    return SIMFS_OK;
+}
+
+/* Write back the metadata and release the image.  The image stays mounted
+ * if any file is still open.
+ */
+int
+simfs_unmount(simfs *fs)
+{
+    for(int i = 0; i < MAXFILES; i++){
+        if(fs->opens[i] > 0){
+            return SIMFS_EBUSY;
+        }
+    }
+    int err = simfs_sync(fs);
+    for(int i = 0; i < fs->layout.members; i++){
+        if(close(fs->fds[i]) != 0 && err == SIMFS_OK){
+            err = SIMFS_EIO;
+        }
+    }
+    free(fs);
+    return err;
+}
+
+/* The namespace.
+ */
+
+int
+simfs_create(simfs *fs, const char *path)
+{
+    return createentry(fs, path, FT_FILE);
+}
+
+int
+simfs_mkdir(simfs *fs, const char *path)
+{
+    return createentry(fs, path, FT_DIR);
+}
+
+/* Remove a file, returning its blocks to the free list.  Their contents
+ * are left as they are; blocks are cleared as they are allocated.
+ */
+int
+simfs_unlink(simfs *fs, const char *path)
+{
+    int slot;
+    int err = findentry(fs, path, &slot);
+    if(err != SIMFS_OK){
+        return err;
+    }
+    if(slot == -1 || fs->files[slot].mode == FT_DIR){
+        return SIMFS_EISDIR;
+    }
+    if(fs->opens[slot] > 0){
+        return SIMFS_EBUSY;
+    }
+
+    fentry *f = &fs->files[slot];
+    int link = f->firstblock;
+    while(link != -1){
+        int node = LINKNODE(link);
+        link = fs->nodes[node].nextblock;
+        fs->nodes[node].blockindex = -node;
+        fs->nodes[node].nextblock = -1;
+        fs->nodedirty[node] = 1;
+    }
+    clearentry(f);
+    fs->filedirty[slot] = 1;
+    return SIMFS_OK;
+}
+
+int
+simfs_rmdir(simfs *fs, const char *path)
+{
+    int slot;
+    int err = findentry(fs, path, &slot);
+    if(err != SIMFS_OK){
+        return err;
+    }
+    if(slot == -1){
+        return SIMFS_EINVAL;
+    }
+    if(fs->files[slot].mode != FT_DIR){
+        return SIMFS_ENOTDIR;
+    }
+    for(int i = 0; i < MAXFILES; i++){
+        if(fs->files[i].name[0] != '\0' && fs->files[i].parent == slot){
+            return SIMFS_ENOTEMPTY;
+        }
+    }
+    clearentry(&fs->files[slot]);
+    fs->filedirty[slot] = 1;
+    return SIMFS_OK;
+}
+
+int
+simfs_getattr(simfs *fs, const char *path, simfs_stat *st)
+{
+    int slot;
+    int err = findentry(fs, path, &slot);
+    if(err != SIMFS_OK){
+        return err;
+    }
+    if(slot == -1){
+        st->mode = FT_DIR;
+        st->size = 0;
+    }
+    else{
+        st->mode = fs->files[slot].mode;
+        st->size = fs->files[slot].size;
+    }
+    return SIMFS_OK;
+}
+
+/* Store up to maxents entries of the directory at path in ents, sorted by
+ * name.  Returns the number of entries in the directory, which may be more
+ * than maxents.
+ */
+int
+simfs_readdir(simfs *fs, const char *path, simfs_dirent *ents, int maxents)
+{
+    simfs_dirent all[MAXFILES];
+    int count = 0;
+    int slot;
+    int err = findentry(fs, path, &slot);
+    if(err != SIMFS_OK){
+        return err;
+    }
+    if(slot != -1 && fs->files[slot].mode != FT_DIR){
+        return SIMFS_ENOTDIR;
+    }
+    for(int i = 0; i < MAXFILES; i++){
+        fentry *f = &fs->files[i];
+        if(f->name[0] != '\0' && f->parent == slot){
+            memcpy(all[count].name, f->name, sizeof(all[count].name));
+            all[count].mode = f->mode;
+            all[count].size = f->size;
+            count++;
+        }
+    }
+    qsort(all, count, sizeof(simfs_dirent), comparedirents);
+    memcpy(ents, all, sizeof(simfs_dirent) * (count < maxents ? count : maxents));
+    return count;
+}
+
+/* File handles.
+ */
+
+int
+simfs_open(simfs *fs, const char *path, simfs_file **fhp)
+{
+    int slot;
+    int err = findentry(fs, path, &slot);
+    if(err != SIMFS_OK){
+        return err;
+    }
+    if(slot == -1 || fs->files[slot].mode == FT_DIR){
+        return SIMFS_EISDIR;
+    }
+    simfs_file *fh = malloc(sizeof(simfs_file));
+    if(fh == NULL){
+        return SIMFS_ENOMEM;
+    }
+    fh->fs = fs;
+    fh->slot = slot;
+    fh->posblock = 0;
+    fh->posnode = -1;
+    fs->opens[slot]++;
+    *fhp = fh;
+    return SIMFS_OK;
+}
+
+int
+simfs_close(simfs_file *fh)
+{
+    fh->fs->opens[fh->slot]--;
+    free(fh);
+    return SIMFS_OK;
+}
+
+unsigned int
+simfs_size(simfs_file *fh)
+{
+    return fh->fs->files[fh->slot].size;
+}
+
+/* A piece of a transfer that is contiguous in one member, or a run of
+ * holes if member is -1.
+ */
+typedef struct segment {
+    int member;
+    off_t at;
+    size_t pos;                 // Where the piece starts in the transfer.
+    size_t len;
+} segment;
+
+/* A transfer has at most one segment per block, with runs of holes
+ * between them.
+ */
+#define MAXSEGMENTS (2 * MAXBLOCKS + 1)
+
+typedef struct memberio {
+    simfs *fs;
+    char *buf;
+    segment *segs;
+    int nsegs;
+    int member;
+    int writing;
+    int err;
+} memberio;
+
+/* Do the segments of a transfer that belong to one member. */
+static void *
+memberworker(void *arg)
+{
+    memberio *io = arg;
+    int fd = io->fs->fds[io->member];
+    io->err = SIMFS_OK;
+    for(int i = 0; i < io->nsegs && io->err == SIMFS_OK; i++){
+        segment *seg = &io->segs[i];
+        if(seg->member == io->member){
+            io->err = io->writing ? writeall(fd, io->buf + seg->pos, seg->len, seg->at)
+                                  : readall(fd, io->buf + seg->pos, seg->len, seg->at);
+        }
+    }
+    return NULL;
+}
+
+/* Do a list of segments, with one thread per member involved so that the
+ * members are busy at the same time.
+ */
+static int
+runsegments(simfs *fs, char *buf, segment *segs, int nsegs, int writing)
+{
+    memberio ios[SIMFS_MAXMEMBERS];
+    pthread_t threads[SIMFS_MAXMEMBERS];
+    int started[SIMFS_MAXMEMBERS] = {0};
+    int used[SIMFS_MAXMEMBERS] = {0};
+    int err = SIMFS_OK;
+    int m;
+
+    for(int i = 0; i < nsegs; i++){
+        if(segs[i].member != -1){
+            used[segs[i].member] = 1;
+        }
+    }
+    for(m = 0; m < fs->layout.members; m++){
+        ios[m] = (memberio){fs, buf, segs, nsegs, m, writing, SIMFS_OK};
+    }
+
+    /* The calling thread does the first member's share itself. */
+    int first = -1;
+    for(m = 0; m < fs->layout.members; m++){
+        if(!used[m]){
+            continue;
+        }
+        if(first == -1){
+            first = m;
+        }
+        else if(pthread_create(&threads[m], NULL, memberworker, &ios[m]) == 0){
+            started[m] = 1;
+        }
+        else{
+            memberworker(&ios[m]);
+        }
+    }
+    if(first != -1){
+        memberworker(&ios[first]);
+    }
+    for(m = 0; m < fs->layout.members; m++){
+        if(started[m]){
+            pthread_join(threads[m], NULL);
+        }
+        if(used[m] && ios[m].err != SIMFS_OK){
+            err = ios[m].err;
+        }
+    }
+    return err;
+}
+
+/* Split len bytes of the file at offset into segments, merging blocks
+ * that are consecutive within a member so that each segment takes a single
+ * system call.  Returns the number of segments.
+ */
+static int
+mapsegments(simfs_file *fh, size_t len, off_t offset, segment *segs)
+{
+    simfs *fs = fh->fs;
+    int nsegs = 0;
+    int k = offset / BLOCKSIZE;
+    size_t done = 0;
+    int pos;
+    int node = seekblock(fh, k, &pos);
+
+    while(done < len){
+        off_t at = offset + done;
+        size_t n = BLOCKSIZE - at % BLOCKSIZE;
+        int member = -1;
+        off_t where = 0;
+        if(n > len - done){
+            n = len - done;
+        }
+        if(node != -1 && pos == k){
+            where = blockaddr(fs, node, &member) + at % BLOCKSIZE;
+            fh->posblock = k;
+            fh->posnode = node;
+            int link = fs->nodes[node].nextblock;
+            node = link == -1 ? -1 : LINKNODE(link);
+            pos = k + 1 + LINKHOLES(link);
+        }
+        segment *last = nsegs > 0 ? &segs[nsegs - 1] : NULL;
+        if(last != NULL && last->member == member &&
+           (member == -1 || last->at + (off_t)last->len == where)){
+            last->len += n;
+        }
+        else{
+            segs[nsegs++] = (segment){member, where, done, n};
+        }
+        done += n;
+        k++;
+    }
+    return nsegs;
+}
+
+/* Move len bytes between buf and the file at offset.  Holes read as zeros
+ * without any I/O; a write must not touch any.
+ */
+static ssize_t
+copyblocks(simfs_file *fh, char *buf, size_t len, off_t offset, int writing)
+{
+    segment segs[MAXSEGMENTS];
+    int nsegs = mapsegments(fh, len, offset, segs);
+
+    for(int i = 0; i < nsegs; i++){
+        if(segs[i].member != -1){
+            continue;
+        }
+        if(writing){
+            return SIMFS_EIO;
+        }
+        memset(buf + segs[i].pos, 0, segs[i].len);
+    }
+    int err = runsegments(fh->fs, buf, segs, nsegs, writing);
+    if(err != SIMFS_OK){
+        return err;
+    }
+    return len;
+}
+
+/* Move all len bytes between buf and the descriptor fd with read(2) or
+ * write(2), carrying on after short transfers and interruptions.  Running
+ * out of input counts as an error.
+ */
+static int
+fdtransfer(int fd, char *buf, size_t len, int writing)
+{
+    while(len > 0){
+        ssize_t n = writing ? write(fd, buf, len) : read(fd, buf, len);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            return SIMFS_EIO;
+        }
+        buf += n;
+        len -= n;
+    }
+    return SIMFS_OK;
+}
+
+int
+simfs_readfd(int fd, void *buf, size_t len)
+{
+    return fdtransfer(fd, buf, len, 0);
+}
+
+int
+simfs_writefd(int fd, const void *buf, size_t len)
+{
+    return fdtransfer(fd, (char *)buf, len, 1);
+}
+
+static int
+putzeros(int out, size_t len)
+{
+    char zerobuf[BLOCKSIZE] = {0};
+    while(len > 0){
+        size_t n = len < BLOCKSIZE ? len : BLOCKSIZE;
+        if(simfs_writefd(out, zerobuf, n) != SIMFS_OK){
+            return SIMFS_EIO;
+        }
+        len -= n;
+    }
+    return SIMFS_OK;
+}
+
+/* Copy len bytes at offset at of the member fd to out, inside the kernel
+ * when it can.  If sendfile cannot be used between the two descriptors the
+ * bytes are copied through a buffer instead.
+ */
+static int
+sendsegment(int out, int fd, off_t at, size_t len)
+{
+    char buf[BLOCKSIZE];
+    int buffered = 0;
+
+    while(len > 0){
+        ssize_t n;
+        if(!buffered){
+            n = sendfile(out, fd, &at, len);
+            if(n < 0 && errno == EINTR){
+                continue;
+            }
+            if(n < 0 && (errno == EINVAL || errno == ENOSYS)){
+                buffered = 1;
+                continue;
+            }
+            if(n < 0){
+                return SIMFS_EIO;
+            }
+            if(n == 0){
+                /* Past the end of the member, as readall treats it. */
+                return putzeros(out, len);
+            }
+        }
+        else{
+            n = len < BLOCKSIZE ? len : BLOCKSIZE;
+            if(readall(fd, buf, n, at) != SIMFS_OK || simfs_writefd(out, buf, n) != SIMFS_OK){
+                return SIMFS_EIO;
+            }
+            at += n;
+        }
+        len -= n;
+    }
+    return SIMFS_OK;
+}
+
+/* Read up to len bytes at offset.  Returns the number of bytes read, which
+ * is short only at the end of the file.
+ */
+ssize_t
+simfs_pread(simfs_file *fh, void *buf, size_t len, off_t offset)
+{
+    fentry *f = &fh->fs->files[fh->slot];
+
+    if(offset < 0){
+        return SIMFS_EINVAL;
+    }
+    if(offset >= f->size){
+        return 0;
+    }
+    if(len > (size_t)(f->size - offset)){
+        len = f->size - offset;
+    }
+    return copyblocks(fh, buf, len, offset, 0);
+}
+
+/* Read up to len bytes at offset into the descriptor out, normally a pipe
+ * or a socket.  Runs of blocks that are consecutive within a member go
+ * straight from the image with sendfile(2), without being copied through
+ * user space; holes are written from a buffer of zeros.  Returns the number
+ * of bytes read, which is short only at the end of the file.
+ */
+ssize_t
+simfs_sendfile(simfs_file *fh, int out, size_t len, off_t offset)
+{
+    segment segs[MAXSEGMENTS];
+    fentry *f = &fh->fs->files[fh->slot];
+
+    if(offset < 0){
+        return SIMFS_EINVAL;
+    }
+    if(offset >= f->size){
+        return 0;
+    }
+    if(len > (size_t)(f->size - offset)){
+        len = f->size - offset;
+    }
+    int nsegs = mapsegments(fh, len, offset, segs);
+    for(int i = 0; i < nsegs; i++){
+        segment *seg = &segs[i];
+        int err = seg->member == -1 ? putzeros(out, seg->len)
+                                    : sendsegment(out, fh->fs->fds[seg->member], seg->at, seg->len);
+        if(err != SIMFS_OK){
+            return err;
+        }
+    }
+    return len;
+}
+
+/* Write len bytes at offset.  An offset past the end of the file leaves a
+ * hole: the blocks between the old end and the write are not allocated and
+ * read as zeros.  All the blocks the write needs are allocated before any
+ * data is written, so a write either fits completely or fails with
+ * SIMFS_ENOSPC.
+ *
+ * A write that only touches allocated blocks within the file's size
+ * changes no metadata, so such writes may run concurrently on different
+ * handles.
+ */
+ssize_t
+simfs_pwrite(simfs_file *fh, const void *buf, size_t len, off_t offset)
+{
+    simfs *fs = fh->fs;
+    fentry *f = &fs->files[fh->slot];
+    int pos;
+
+    if(offset < 0){
+        return SIMFS_EINVAL;
+    }
+    if(len > SIMFS_MAXFILESIZE || offset + len > SIMFS_MAXFILESIZE){
+        return SIMFS_EFBIG;
+    }
+    if(len == 0){
+        return 0;
+    }
+    int first = offset / BLOCKSIZE;
+    int last = (offset + len - 1) / BLOCKSIZE;
+    int have = nblocks(f->size);
+    if(countholes(fh, first, last) > countfree(fs)){
+        return SIMFS_ENOSPC;
+    }
+
+    /* Fill the holes the write lands in, then extend the chain past the
+     * old last block, and only then copy the data.
+     */
+    int node;
+    for(int k = first; k <= last && k < have - 1; k++){
+        if(seekblock(fh, k, &pos) == -1 || pos == k){
+            continue;
+        }
+        if((node = fillhole(fh, k)) < 0){
+            return node;
+        }
+        if(clearuncovered(fs, node, k, offset, len) != SIMFS_OK){
+            return SIMFS_EIO;
+        }
+    }
+    if(offset > f->size && zerotail(fs, fh->slot) != SIMFS_OK){
+        return SIMFS_EIO;
+    }
+    int tailpos = have - 1;
+    for(int k = first > have ? first : have; k <= last; k++){
+        if((node = allocblock(fs)) < 0){
+            return node;
+        }
+        chainblock(fs, fh->slot, node, k - tailpos - 1);
+        if(clearuncovered(fs, node, k, offset, len) != SIMFS_OK){
+            return SIMFS_EIO;
+        }
+        tailpos = k;
+    }
+    if(offset + len > f->size){
+        f->size = offset + len;
+        fs->filedirty[fh->slot] = 1;
+    }
+    return copyblocks(fh, (char *)buf, len, offset, 1);
+}
+
+/* Grow the file to size bytes, taking the new blocks as one run of
+ * consecutive blocks when the file system has such a run.  If clear is
+ * not set only the slack past size in the last block is cleared.
+ */
+static int
+growfile(simfs_file *fh, unsigned int size, int clear)
+{
+    simfs *fs = fh->fs;
+    fentry *f = &fs->files[fh->slot];
+
+    if(size > SIMFS_MAXFILESIZE){
+        return SIMFS_EFBIG;
+    }
+    if(size <= f->size){
+        return SIMFS_OK;
+    }
+    int have = nblocks(f->size);
+    int need = nblocks(size);
+    if(need - have > countfree(fs)){
+        return SIMFS_ENOSPC;
+    }
+    if(zerotail(fs, fh->slot) != SIMFS_OK){
+        return SIMFS_EIO;
+    }
+    int run = need > have ? simfs_findfreerun(fs->nodes, need - have) : -1;
+    for(int i = have; i < need; i++){
+        int node;
+        if(run != -1){
+            node = run + i - have;
+            useblock(fs, node);
+        }
+        else{
+            node = allocblock(fs);
+        }
+        chainblock(fs, fh->slot, node, 0);
+        if(clear || i == need - 1){
+            if(clearuncovered(fs, node, i, 0, clear ? 0 : size) != SIMFS_OK){
+                return SIMFS_EIO;
+            }
+        }
+    }
+    f->size = size;
+    fs->filedirty[fh->slot] = 1;
+    return SIMFS_OK;
+}
+
+/* Grow the file to size bytes.  The new blocks read as zeros.  Does
+ * nothing if the file is already that large.
+ */
+int
+simfs_fallocate(simfs_file *fh, unsigned int size)
+{
+    return growfile(fh, size, 1);
+}
+
+/* Grow the file to size bytes like simfs_fallocate, but leave the new
+ * blocks as they are, for a caller that writes every byte of them before
+ * the metadata is synced.
+ */
+int
+simfs_reserve(simfs_file *fh, unsigned int size)
+{
+    return growfile(fh, size, 0);
+}
+
+/* Write len bytes at the end of the file.  This goes straight to the last
+ * block, so its cost does not depend on the length of the file.
+ */
+ssize_t
+simfs_append(simfs_file *fh, const void *buf, size_t len)
+{
+    return simfs_pwrite(fh, buf, len, simfs_size(fh));
+}
+
+/* Direct access for the file system tools.
+ */
+
+void
+simfs_getlayout(simfs *fs, fslayout *layout)
+{
+    *layout = fs->layout;
+}
+
+void
+simfs_getmeta(simfs *fs, fentry *files, fnode *nodes)
+{
+    memcpy(files, fs->files, sizeof(fs->files));
+    memcpy(nodes, fs->nodes, sizeof(fs->nodes));
+}
+
+/* Return the first block of the lowest run of len free blocks in the
+ * node table, or -1 if there is no such run.
+ */
+int
+simfs_findfreerun(const fnode *nodes, int len)
+{
+    int start = SIMFS_METABLOCKS;
+    for(int i = SIMFS_METABLOCKS; i < MAXBLOCKS; i++){
+        if(nodes[i].blockindex >= 0){
+            start = i + 1;
+        }
+        else if(i - start + 1 == len){
+            return start;
+        }
+    }
+    return -1;
+}
+
+/* Replace the metadata and write all of it to disk before returning. */
+int
+simfs_putmeta(simfs *fs, const fentry *files, const fnode *nodes)
+{
+    memcpy(fs->files, files, sizeof(fs->files));
+    memcpy(fs->nodes, nodes, sizeof(fs->nodes));
+    memset(fs->filedirty, 1, sizeof(fs->filedirty));
+    memset(fs->nodedirty, 1, sizeof(fs->nodedirty));
+    int err = simfs_sync(fs);
+    if(err != SIMFS_OK){
+        return err;
+    }
+    return simfs_flush(fs);
+}
+
+int
+simfs_readblock(simfs *fs, int block, void *buf)
+{
+    int member;
+    if(block < 0 || block >= MAXBLOCKS){
+        return SIMFS_EINVAL;
+    }
+    off_t at = blockaddr(fs, block, &member);
+    return readall(fs->fds[member], buf, BLOCKSIZE, at);
+}
+
+int
+simfs_writeblock(simfs *fs, int block, const void *buf)
+{
+    int member;
+    if(block < 0 || block >= MAXBLOCKS){
+        return SIMFS_EINVAL;
+    }
+    off_t at = blockaddr(fs, block, &member);
+    return writeall(fs->fds[member], buf, BLOCKSIZE, at);
+}
+
+/* Wait until everything written so far is on disk in every member. */
+int
+simfs_flush(simfs *fs)
+{
+    for(int i = 0; i < fs->layout.members; i++){
+        if(fsync(fs->fds[i]) != 0){
+            return SIMFS_EIO;
+        }
+    }
+    return SIMFS_OK;
+}
@@ -0,0 +1,102 @@
+/* libsimfs: the simulated file system as a library.
+ *
+ * An image is one backing file, or several with the data blocks striped
+ * across them.  It is mounted once, after which any number of files can be
+ * opened and read or written through handles.  The metadata is kept in
+ * memory while the image is mounted and written back by simfs_sync and
+ * simfs_unmount.  No function exits the process: every error is reported
+ * as one of the negative SIMFS_E* codes below.
+ */
+
+#ifndef LIBSIMFS_H
+#define LIBSIMFS_H
+
+#include <sys/types.h>
+#include "simfstypes.h"
+
+#define SIMFS_OK             0
+#define SIMFS_EIO           -1   // Reading or writing the image failed.
+#define SIMFS_ENOENT        -2   // No such file or directory.
+#define SIMFS_EEXIST        -3   // The name is already in use.
+#define SIMFS_ENOTDIR       -4   // A path component is not a directory.
+#define SIMFS_EISDIR        -5   // The operation needs a file, not a directory.
+#define SIMFS_ENOTEMPTY     -6   // The directory still has entries.
+#define SIMFS_ENAMETOOLONG  -7   // A path component does not fit in an fentry.
+#define SIMFS_ENOSPC        -8   // No free fentry or not enough free blocks.
+#define SIMFS_EINVAL        -9   // Invalid path, offset or length.
+#define SIMFS_EFBIG        -10   // The file would exceed the maximum file size.
+#define SIMFS_ENOMEM       -11   // Memory allocation failed.
+#define SIMFS_EBUSY        -12   // The file is open.
+
+/* The largest file an fentry can describe. */
+#define SIMFS_MAXFILESIZE   65535
+
+/* The most backing files an image can be striped across. */
+#define SIMFS_MAXMEMBERS    8
+
+/* The metadata at the start of the image: the fentries, the fnodes and the
+ * layout, padded out to whole blocks.  Data blocks start after it.
+ */
+#define SIMFS_METABYTES     (sizeof(fentry) * MAXFILES + sizeof(fnode) * MAXBLOCKS + sizeof(fslayout))
+#define SIMFS_METABLOCKS    ((int)((SIMFS_METABYTES - 1) / BLOCKSIZE + 1))
+
+typedef struct simfs simfs;
+typedef struct simfs_file simfs_file;
+
+typedef struct simfs_stat {
+    int mode;                   // FT_FILE or FT_DIR.
+    unsigned int size;
+} simfs_stat;
+
+typedef struct simfs_dirent {
+    char name[sizeof(((fentry *)0)->name)];
+    int mode;
+    unsigned int size;
+} simfs_dirent;
+
+const char *simfs_strerror(int err);
+
+/* Whole images */
+int simfs_format(const char *image, int members, int stripeunit);
+int simfs_mount(const char *image, simfs **fsp);
+int simfs_sync(simfs *fs);
+int simfs_unmount(simfs *fs);
+
+/* The namespace */
+int simfs_create(simfs *fs, const char *path);
+int simfs_unlink(simfs *fs, const char *path);
+int simfs_mkdir(simfs *fs, const char *path);
+int simfs_rmdir(simfs *fs, const char *path);
+int simfs_getattr(simfs *fs, const char *path, simfs_stat *st);
+int simfs_readdir(simfs *fs, const char *path, simfs_dirent *ents, int maxents);
+
+/* File handles */
+int simfs_open(simfs *fs, const char *path, simfs_file **fhp);
+int simfs_close(simfs_file *fh);
+unsigned int simfs_size(simfs_file *fh);
+ssize_t simfs_pread(simfs_file *fh, void *buf, size_t len, off_t offset);
+ssize_t simfs_sendfile(simfs_file *fh, int out, size_t len, off_t offset);
+ssize_t simfs_pwrite(simfs_file *fh, const void *buf, size_t len, off_t offset);
+ssize_t simfs_append(simfs_file *fh, const void *buf, size_t len);
+int simfs_fallocate(simfs_file *fh, unsigned int size);
+int simfs_reserve(simfs_file *fh, unsigned int size);
+
+/* Whole reads and writes on host descriptors, such as pipes and the files
+ * import and export copy, retrying after short transfers.
+ */
+int simfs_readfd(int fd, void *buf, size_t len);
+int simfs_writefd(int fd, const void *buf, size_t len);
+
+/* Direct access to the metadata and blocks, for printfs, fsck and defrag.
+ * The tables are copied out and in; simfs_putmeta writes them to disk
+ * before returning, and simfs_flush waits for earlier block writes.
+ */
+void simfs_getlayout(simfs *fs, fslayout *layout);
+void simfs_getmeta(simfs *fs, fentry *files, fnode *nodes);
+int simfs_putmeta(simfs *fs, const fentry *files, const fnode *nodes);
+int simfs_findfreerun(const fnode *nodes, int len);
+int simfs_readblock(simfs *fs, int block, void *buf);
+int simfs_writeblock(simfs *fs, int block, const void *buf);
+int simfs_flush(simfs *fs);
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "simfs.h"
+#include "libsimfs.h"
 
 
 /* Print the contents of the file system file in a readable form. */
@@ -9,37 +10,30 @@ void
 printfs(char *filename) {
     fentry files[MAXFILES];
     fnode fnodes[MAXBLOCKS];
-    char block[BLOCKSIZE + 1];
+    fslayout layout;
+    char block[BLOCKSIZE];
+    simfs *fs;
+    int err;
     int i;
 
-    FILE *fp = openfs(filename, "r");
-
-    if ((fread(files, sizeof(fentry), MAXFILES, fp)) == 0) {
-        fprintf(stderr, "Error: could not read file entries\n");
-        closefs(fp);
-        exit(1);
-    }
-    if ((fread(fnodes, sizeof(fnode), MAXBLOCKS, fp)) == 0) {
-        fprintf(stderr, "Error: could not read fnodes\n");
-        closefs(fp);
-        exit(1);
-    }
-    int bytes_used = sizeof(fentry) * MAXFILES + sizeof(fnode) * MAXBLOCKS;
-    int bytes_to_read = (BLOCKSIZE - (bytes_used % BLOCKSIZE)) % BLOCKSIZE;
-    if (bytes_to_read != 0  && fseek(fp, bytes_to_read, SEEK_CUR) != 0) {
-        fprintf(stderr, "Error: seek failed during print\n");
-        closefs(fp);
+    if ((err = simfs_mount(filename, &fs)) != SIMFS_OK) {
+        fprintf(stderr, "Error: %s\n", simfs_strerror(err));
         exit(1);
     }
+    simfs_getmeta(fs, files, fnodes);
+    simfs_getlayout(fs, &layout);
 
     printf("File entry structures:\n");
 
     for (i = 0; i < MAXFILES; i++) {
-        printf("[%d] \"%s\"\t%hu\t%hd\n",
+        printf("[%d] \"%s\"\t%hu\t%hd\t%hd\t%hd\t%s\n",
                i,
                files[i].name,
                files[i].size,
-               files[i].firstblock);
+               files[i].firstblock,
+               files[i].lastblock,
+               files[i].parent,
+               files[i].mode == FT_DIR ? "dir" : "file");
     }
 
     printf("\nFile node structures:\n");
@@ -50,17 +44,27 @@ printfs(char *filename) {
                fnodes[i].nextblock);
     }
 
-    /* Write the raw file data to standard out */
+    printf("\nLayout: %hd members, stripe unit %hd\n",
+           layout.members, layout.stripeunit);
+
+    /* Write the raw file data, up to the last block in use, to standard
+     * out.
+     */
+    int last_used = SIMFS_METABLOCKS - 1;
+    for (i = SIMFS_METABLOCKS; i < MAXBLOCKS; i++) {
+        if (fnodes[i].blockindex > 0) {
+            last_used = i;
+        }
+    }
     printf("\nFile blocks:\n");
-    while (fread(block, 1, BLOCKSIZE, fp) == BLOCKSIZE) {
+    for (i = SIMFS_METABLOCKS; i <= last_used; i++) {
+        if (simfs_readblock(fs, i, block) != SIMFS_OK) {
+            fprintf(stderr, "Error: could not read data block\n");
+            exit(1);
+        }
         fwrite(block, BLOCKSIZE, 1, stdout);
     }
-    if (ferror(fp)) {
-        fprintf(stderr, "Error: could not read data block\n");
-        closefs(fp);
-        exit(1);
-    }
 
     printf("\n");
-    closefs(fp);
+    simfs_unmount(fs);
 }
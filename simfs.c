@@ -1,6 +1,7 @@
 /* This program simulates a file system within an actual file.  The
- * simulated file system has only one directory, and two types of
- * metadata structures defined in simfstypes.h.
+ * simulated file system has a tree of directories, and two types of
+ * metadata structures defined in simfstypes.h.  Files and directories
+ * are named by paths such as dir/sub/file.
  */
 
 /* Simfs is run as:
@@ -9,6 +10,15 @@
  * occupies, the command is the command to be run on the simulated file system,
  * and args represents a list of arguments for the command.  Note that
  * different commands take different numbers of arguments.
+ *
+ * An image created with "initfs members stripeunit" stripes its data blocks
+ * across myfs, myfs.1, ..., myfs.<members-1>.  Only myfs is named on the
+ * command line; the others are found from the layout recorded in it.
+ *
+ * Setting SIMFS_TRACE to a file name appends a record of each command to
+ * that trace, with a hash of the data read or written if SIMFS_TRACEHASH
+ * is set too.  "replay trace [timed]" runs the commands of a trace against
+ * the image and reports how long each kind took.
  */
 
 #include <stdio.h>
@@ -16,11 +26,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include "simfs.h"
+#include "libsimfs.h"
 
 // We use the ops array to match the file system command entered by the user.
-#define MAXOPS  6
+#define MAXOPS  15
 char *ops[MAXOPS] = {"initfs", "printfs", "createfile", "readfile",
-                     "writefile", "deletefile"};
+                     "writefile", "deletefile", "fsck", "defrag",
+                     "mkdir", "rmdir", "listdir", "appendfile",
+                     "import", "export", "replay"};
 int find_command(char *);
 
 int main(int argc, char **argv){
@@ -51,9 +64,32 @@ int main(int argc, char **argv){
     cmd = argv[optind];
     optind++;
 
-    switch((find_command(cmd))) {
+    int command = find_command(cmd);
+    if(command != -1){
+        tracestart(ops[command], argc - optind, argv + optind);
+    }
+
+    switch(command) {
     case 0: /* initfs */
-        initfs(fsname);
+        if(argc == 4){
+            initfs(fsname, 1, 1);
+        }
+        else if(argc == 6){
+            char *members_error;
+            char *unit_error;
+            long members = strtol(argv[optind], &members_error, 10);
+            long unit = strtol(argv[optind + 1], &unit_error, 10);
+            if(strlen(members_error) != 0 || strlen(unit_error) != 0 ||
+               members < 1 || unit < 1 || members > SIMFS_MAXMEMBERS || unit > MAXBLOCKS){
+                fprintf(stderr, "Not a valid stripe layout\n");
+                exit(1);
+            }
+            initfs(fsname, members, unit);
+        }
+        else{
+            fprintf(stderr, "Usage: simfs -f file initfs [members stripeunit]\n");
+            exit(1);
+        }
         break;
     case 1: /* printfs */
         printfs(fsname);
@@ -110,11 +146,134 @@ int main(int argc, char **argv){
         deletefile(fsname, argv[optind]);
         break;
         }
+    case 6: /* fsck */
+        if(argc > 5){
+            fprintf(stderr, "Too many arguments\t%s", usage_string);
+            exit(1);
+        }
+        else if(argc == 5 && strcmp(argv[optind], "repair") != 0){
+            fprintf(stderr, "Unknown fsck mode %s\t%s", argv[optind], usage_string);
+            exit(1);
+        }
+        else if(fsck(fsname, argc == 5) != 0){
+            exit(1);
+        }
+        break;
+    case 7: /* defrag */
+        if(argc > 5){
+            fprintf(stderr, "Too many arguments\t%s", usage_string);
+            exit(1);
+        }
+        else if(argc == 5){
+            char *limit_error;
+            long limit = strtol(argv[optind], &limit_error, 10);
+            if(strlen(limit_error) != 0 || limit < 0 || limit > MAXBLOCKS){
+                fprintf(stderr, "Not a valid block limit\n");
+                exit(1);
+            }
+            defrag(fsname, limit);
+        }
+        else{
+            defrag(fsname, -1);
+        }
+        break;
+    case 8: /* mkdir */
+        if(argc < 5){
+            fprintf(stderr, "Missing directory name\t%s", usage_string);
+            exit(1);
+        }
+        else if(argc > 5){
+            fprintf(stderr, "Too many arguments\t%s", usage_string);
+            exit(1);
+        }
+        else{
+            makedir(fsname, argv[optind]);
+            break;
+        }
+    case 9: /* rmdir */
+        if(argc < 5){
+            fprintf(stderr, "Missing directory name\t%s", usage_string);
+            exit(1);
+        }
+        else if(argc > 5){
+            fprintf(stderr, "Too many arguments\t%s", usage_string);
+            exit(1);
+        }
+        else{
+            removedir(fsname, argv[optind]);
+            break;
+        }
+    case 10: /* listdir */
+        if(argc > 5){
+            fprintf(stderr, "Too many arguments\t%s", usage_string);
+            exit(1);
+        }
+        else{
+            listdir(fsname, argc == 5 ? argv[optind] : "/");
+            break;
+        }
+    case 11: /* appendfile */
+        if(argc < 6){
+            fprintf(stderr, "Missing arguments\t%s", usage_string);
+            exit(1);
+        }
+        else if(argc > 6){
+            fprintf(stderr, "Too many arguments\t%s", usage_string);
+            exit(1);
+        }
+        else{
+            appendfile(fsname, argv[optind], argv[optind + 1]);
+            break;
+        }
+    case 12: /* import */
+        if(argc < 5){
+            fprintf(stderr, "Missing host directory\t%s", usage_string);
+            exit(1);
+        }
+        else if(argc > 5){
+            fprintf(stderr, "Too many arguments\t%s", usage_string);
+            exit(1);
+        }
+        else{
+            importfs(fsname, argv[optind]);
+            break;
+        }
+    case 13: /* export */
+        if(argc < 5){
+            fprintf(stderr, "Missing host directory\t%s", usage_string);
+            exit(1);
+        }
+        else if(argc > 5){
+            fprintf(stderr, "Too many arguments\t%s", usage_string);
+            exit(1);
+        }
+        else{
+            exportfs(fsname, argv[optind]);
+            break;
+        }
+    case 14: /* replay */
+        if(argc < 5){
+            fprintf(stderr, "Missing trace file\t%s", usage_string);
+            exit(1);
+        }
+        else if(argc > 6){
+            fprintf(stderr, "Too many arguments\t%s", usage_string);
+            exit(1);
+        }
+        else if(argc == 6 && strcmp(argv[optind + 1], "timed") != 0){
+            fprintf(stderr, "Unknown replay mode %s\t%s", argv[optind + 1], usage_string);
+            exit(1);
+        }
+        else{
+            replay(fsname, argv[optind], argc == 6);
+            break;
+        }
     default:
         fprintf(stderr, "Error: Invalid command\n");
         exit(1);
     }
 
+    traceend();
     return 0;
 }
 
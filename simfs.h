@@ -3,14 +3,26 @@
 
 /* File system operations */
 void printfs(char *);
-void initfs(char *);
+void initfs(char *, int, int);
 int createfile(char *, char *);
 int writefile(char *, char *, char *, char *);
 int readfile(char *, char *, char *, char *);
+int appendfile(char *, char *, char *);
 int deletefile(char *, char *);
+int makedir(char *, char *);
+int removedir(char *, char *);
+int listdir(char *, char *);
+int fsck(char *, int);
+int defrag(char *, int);
+int importfs(char *, char *);
+int exportfs(char *, char *);
+int replay(char *, char *, int);
+
+/* Tracing */
+void tracestart(char *command, int nargs, char **args);
+void tracepayload(const void *buf, size_t len);
+int tracehashing(void);
+void traceend(void);
 
 /* Internal functions */
-FILE *openfs(char *filename, char *mode);
-void closefs(FILE *fp);
-int* newNodeCollector(FILE *fp, fentry *files, fnode *nodes, int nodes_needed);
-int* existingNodeCollector(FILE *fp, fentry *files, fnode *nodes, int file_index, int nodes_in_file);
\ No newline at end of file
+int* existingNodeCollector(fentry *files, fnode *nodes, int file_index, int *nodes_in_file);
\ No newline at end of file
@@ -1,15 +1,39 @@
+#ifndef SIMFSTYPES_H
+#define SIMFSTYPES_H
+
 typedef struct file_entry {
   char name[12];          // An empty name means the fentry is not in use.
   unsigned short size;
-  short firstblock;       // A -1 indicates that no file blocks have been allocated.
+  short firstblock;       // Link to the first allocated block, -1 if there is none.
+  short lastblock;        // The last block of the chain, -1 along with firstblock.
+  short parent;           // fentry index of the containing directory, -1 for the root.
+  short mode;             // FT_FILE or FT_DIR.  Directories never have blocks.
 } fentry;
 
 typedef struct file_node {
   short blockindex;       // Negative value means this block is not in use.
-  short nextblock;        // A -1 indicates there is no next block of data.
+  short nextblock;        // Link to the next allocated block, -1 if there is none.
 } fnode;
 
+typedef struct fs_layout {
+  short members;          // Number of backing files the data blocks are striped across.
+  short stripeunit;       // Number of consecutive data blocks placed on one member.
+} fslayout;
+
 
 #define MAXFILES  8
 #define MAXBLOCKS 32
 #define BLOCKSIZE 128
+
+#define FT_FILE   0
+#define FT_DIR    1
+
+/* A link in a file's chain (firstblock or nextblock) names the next
+ * allocated block and the number of holes, unallocated blocks that read as
+ * zeros, skipped before it.  The last block of a file is never a hole.
+ */
+#define CHAINLINK(node, holes)  ((node) + MAXBLOCKS * (holes))
+#define LINKNODE(link)          ((link) % MAXBLOCKS)
+#define LINKHOLES(link)         ((link) / MAXBLOCKS)
+
+#endif
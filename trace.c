@@ -0,0 +1,455 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "simfs.h"
+#include "libsimfs.h"
+
+/* Recording commands to a trace, and replaying a trace against an image.
+ *
+ * When SIMFS_TRACE names a file, every command appends one record to it:
+ * which command it was, the file it named, its offset and length, when it
+ * started and how long it took, and whether it failed.  If SIMFS_TRACEHASH
+ * is also set, the record carries a hash of the data the command read or
+ * wrote.  The data itself is not kept, so a trace stays small.
+ *
+ * A trace starts with TRACEMAGIC, followed by the records.  Each record is
+ * a tracerecord, the 64-bit payload hash if TRACE_HASHED is set, and then
+ * pathlen bytes of path.  Everything is in host byte order.
+ */
+
+#define TRACEMAGIC      "SIMFSTR1"
+#define TRACE_FAILED    0x01    // The command exited with an error.
+#define TRACE_HASHED    0x02    // A payload hash follows the record.
+#define TRACE_REPAIR    0x04    // fsck was run in repair mode.
+
+typedef struct tracerecord {
+    uint64_t start;             // Microseconds since the epoch.
+    uint32_t duration;          // Microseconds.
+    uint32_t offset;
+    uint32_t length;
+    uint8_t op;                 // Index into traceops.
+    uint8_t flags;
+    uint16_t pathlen;
+} tracerecord;
+
+/* The commands a trace can hold, and what their arguments mean: p is the
+ * path, o the offset, l the length and r the fsck mode.  initfs records
+ * its member count and stripe unit as the offset and length.  New commands
+ * go at the end, so that old traces keep their meaning.
+ */
+static const struct {
+    char *name;
+    char *args;
+} traceops[] = {
+    {"initfs", "ol"}, {"printfs", ""}, {"createfile", "p"},
+    {"readfile", "pol"}, {"writefile", "pol"}, {"deletefile", "p"},
+    {"fsck", "r"}, {"defrag", "l"}, {"mkdir", "p"}, {"rmdir", "p"},
+    {"listdir", "p"}, {"appendfile", "pl"}, {"import", "p"},
+    {"export", "p"},
+};
+#define NTRACEOPS ((int)(sizeof(traceops) / sizeof(traceops[0])))
+
+/* The record of the command being traced. */
+static struct {
+    int fd;                     // -1 when not tracing.
+    int hashing;
+    tracerecord rec;
+    uint64_t hash;
+    char path[PATH_MAX];
+    struct timespec began;
+} trace = {.fd = -1};
+
+static uint64_t
+elapsed(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000000000ULL + to->tv_nsec - from->tv_nsec;
+}
+
+static void
+tracewrite(int failed)
+{
+    char buf[sizeof(tracerecord) + sizeof(uint64_t) + PATH_MAX];
+    struct timespec now;
+    size_t len = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    trace.rec.duration = elapsed(&trace.began, &now) / 1000;
+    if(failed){
+        trace.rec.flags |= TRACE_FAILED;
+    }
+    memcpy(buf, &trace.rec, sizeof(tracerecord));
+    len += sizeof(tracerecord);
+    if(trace.rec.flags & TRACE_HASHED){
+        memcpy(buf + len, &trace.hash, sizeof(uint64_t));
+        len += sizeof(uint64_t);
+    }
+    memcpy(buf + len, trace.path, trace.rec.pathlen);
+    len += trace.rec.pathlen;
+
+    /* One write per record, so that commands running at the same time do
+     * not interleave their records.
+     */
+    if(write(trace.fd, buf, len) != (ssize_t)len){
+        fprintf(stderr, "Error writing trace record\n");
+    }
+    close(trace.fd);
+    trace.fd = -1;
+}
+
+/* A command that exits before reaching traceend has failed. */
+static void
+traceexit(void)
+{
+    if(trace.fd != -1){
+        tracewrite(1);
+    }
+}
+
+/* Create an empty trace.  The magic is written to a private file, which is
+ * then linked into place, so that a command starting at the same time
+ * never sees the trace without its magic.  If another command gets there
+ * first, its trace is used.
+ */
+static void
+createtrace(char *tracefile)
+{
+    char tmp[PATH_MAX];
+    int fd;
+
+    if(snprintf(tmp, sizeof(tmp), "%s.%d", tracefile, (int)getpid()) >= (int)sizeof(tmp)){
+        fprintf(stderr, "Path too long: %s\n", tracefile);
+        exit(1);
+    }
+    fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if(fd < 0 || write(fd, TRACEMAGIC, strlen(TRACEMAGIC)) != (ssize_t)strlen(TRACEMAGIC) ||
+       close(fd) != 0 || (link(tmp, tracefile) != 0 && errno != EEXIST)){
+        perror(tracefile);
+        unlink(tmp);
+        exit(1);
+    }
+    unlink(tmp);
+}
+
+/* Start tracing the command, if SIMFS_TRACE asks for it.  args are the
+ * command's arguments, after its name.
+ */
+void
+tracestart(char *command, int nargs, char **args)
+{
+    char *tracefile = getenv("SIMFS_TRACE");
+    struct timespec now;
+    int op;
+
+    if(tracefile == NULL || *tracefile == '\0'){
+        return;
+    }
+    for(op = 0; op < NTRACEOPS; op++){
+        if(strcmp(traceops[op].name, command) == 0){
+            break;
+        }
+    }
+    if(op == NTRACEOPS){
+        return;
+    }
+    trace.fd = open(tracefile, O_WRONLY | O_APPEND);
+    if(trace.fd < 0 && errno == ENOENT){
+        createtrace(tracefile);
+        trace.fd = open(tracefile, O_WRONLY | O_APPEND);
+    }
+    if(trace.fd < 0){
+        perror(tracefile);
+        exit(1);
+    }
+
+    memset(&trace.rec, 0, sizeof(tracerecord));
+    trace.rec.op = op;
+    for(int i = 0; traceops[op].args[i] != '\0' && i < nargs; i++){
+        switch(traceops[op].args[i]){
+        case 'p':
+            trace.rec.pathlen = strnlen(args[i], PATH_MAX);
+            memcpy(trace.path, args[i], trace.rec.pathlen);
+            break;
+        case 'o':
+            trace.rec.offset = strtoul(args[i], NULL, 10);
+            break;
+        case 'l':
+            trace.rec.length = strtoul(args[i], NULL, 10);
+            break;
+        case 'r':
+            if(strcmp(args[i], "repair") == 0){
+                trace.rec.flags |= TRACE_REPAIR;
+            }
+            break;
+        }
+    }
+    trace.hashing = getenv("SIMFS_TRACEHASH") != NULL;
+    trace.hash = 14695981039346656037ULL;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    trace.rec.start = now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+    clock_gettime(CLOCK_MONOTONIC, &trace.began);
+    atexit(traceexit);
+}
+
+/* Add data the command read or wrote to the payload hash (FNV-1a). */
+void
+tracepayload(const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+
+    if(trace.fd == -1 || !trace.hashing){
+        return;
+    }
+    for(size_t i = 0; i < len; i++){
+        trace.hash = (trace.hash ^ p[i]) * 1099511628211ULL;
+    }
+    trace.rec.flags |= TRACE_HASHED;
+}
+
+/* Whether the command's payload is being hashed. */
+int
+tracehashing(void)
+{
+    return trace.fd != -1 && trace.hashing;
+}
+
+/* Record the command as having succeeded. */
+void
+traceend(void)
+{
+    if(trace.fd != -1){
+        tracewrite(0);
+    }
+}
+
+/* Replaying. */
+
+typedef struct opstats {
+    int count;
+    int failed;                 // Failed on replay.
+    int skipped;
+    uint64_t traced;            // Total recorded duration, in microseconds.
+    uint64_t *latency;          // Replay latency of each op, in nanoseconds.
+} opstats;
+
+static int
+comparelatency(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* The p-th percentile of count sorted latencies, by nearest rank. */
+static uint64_t
+percentile(const uint64_t *sorted, int count, int p)
+{
+    int idx = (count * p + 99) / 100 - 1;
+    return sorted[idx < 0 ? 0 : idx];
+}
+
+/* Run one traced command against the image through libsimfs, the way the
+ * command itself would.  Write payloads are filled with a fixed pattern.
+ * Returns SIMFS_OK, a SIMFS_E* code, or 1 if the command is not replayed.
+ */
+static int
+replayop(char *fsname, const tracerecord *rec, const char *path, char *data)
+{
+    simfs *fs;
+    simfs_file *fh = NULL;
+    simfs_dirent ents[MAXFILES];
+    char *name = traceops[rec->op].name;
+    int err;
+
+    if(strcmp(name, "initfs") == 0){
+        if(rec->offset == 0){
+            return simfs_format(fsname, 1, 1);
+        }
+        return simfs_format(fsname, rec->offset, rec->length);
+    }
+    if(strcmp(name, "printfs") == 0 || strcmp(name, "fsck") == 0 ||
+       strcmp(name, "defrag") == 0 || strcmp(name, "import") == 0 ||
+       strcmp(name, "export") == 0){
+        return 1;
+    }
+    if(rec->length > SIMFS_MAXFILESIZE){
+        return SIMFS_EFBIG;
+    }
+    if((err = simfs_mount(fsname, &fs)) != SIMFS_OK){
+        return err;
+    }
+    if(strcmp(name, "createfile") == 0){
+        err = simfs_create(fs, path);
+    }
+    else if(strcmp(name, "deletefile") == 0){
+        err = simfs_unlink(fs, path);
+    }
+    else if(strcmp(name, "mkdir") == 0){
+        err = simfs_mkdir(fs, path);
+    }
+    else if(strcmp(name, "rmdir") == 0){
+        err = simfs_rmdir(fs, path);
+    }
+    else if(strcmp(name, "listdir") == 0){
+        err = simfs_readdir(fs, path, ents, MAXFILES);
+    }
+    else if((err = simfs_open(fs, path, &fh)) == SIMFS_OK){
+        if(strcmp(name, "readfile") == 0){
+            err = simfs_pread(fh, data, rec->length, rec->offset);
+        }
+        else if(strcmp(name, "writefile") == 0){
+            err = simfs_pwrite(fh, data, rec->length, rec->offset);
+        }
+        else{
+            err = simfs_append(fh, data, rec->length);
+        }
+        simfs_close(fh);
+    }
+    int unmounted = simfs_unmount(fs);
+    if(err < 0){
+        return err;
+    }
+    return unmounted;
+}
+
+/* Replay the trace in tracefile against the image fsname and report the
+ * latency of each kind of command.  Commands run back to back, or, if
+ * timed, as far apart as they were when they were recorded.  Commands
+ * that only inspect or reorganise the image as a whole are skipped.
+ */
+int
+replay(char *fsname, char *tracefile, int timed)
+{
+    opstats stats[NTRACEOPS] = {{0}};
+    struct timespec began, before, after;
+    struct stat st;
+    char *data;
+    char *trc;
+    int fd;
+
+    if((fd = open(tracefile, O_RDONLY)) < 0 || fstat(fd, &st) != 0){
+        perror(tracefile);
+        exit(1);
+    }
+    size_t size = st.st_size;
+    trc = malloc(size > 0 ? size : 1);
+    data = malloc(SIMFS_MAXFILESIZE);
+    if(trc == NULL || data == NULL){
+        fprintf(stderr, "%s\n", simfs_strerror(SIMFS_ENOMEM));
+        exit(1);
+    }
+    if(read(fd, trc, size) != (ssize_t)size){
+        perror(tracefile);
+        exit(1);
+    }
+    close(fd);
+    if(size < strlen(TRACEMAGIC) || memcmp(trc, TRACEMAGIC, strlen(TRACEMAGIC)) != 0){
+        fprintf(stderr, "Error: %s is not a trace\n", tracefile);
+        exit(1);
+    }
+    for(int i = 0; i < SIMFS_MAXFILESIZE; i++){
+        data[i] = 'a' + i % 26;
+    }
+
+    /* Every op could be of one kind, so each gets room for all of them. */
+    size_t maxops = (size - strlen(TRACEMAGIC)) / sizeof(tracerecord);
+    for(int op = 0; op < NTRACEOPS; op++){
+        stats[op].latency = malloc(sizeof(uint64_t) * (maxops > 0 ? maxops : 1));
+        if(stats[op].latency == NULL){
+            fprintf(stderr, "%s\n", simfs_strerror(SIMFS_ENOMEM));
+            exit(1);
+        }
+    }
+
+    uint64_t firststart = 0;
+    int nops = 0;
+    int tracefailed = 0;
+    size_t at = strlen(TRACEMAGIC);
+    clock_gettime(CLOCK_MONOTONIC, &began);
+    while(at < size){
+        tracerecord rec;
+        char path[PATH_MAX];
+
+        if(size - at < sizeof(tracerecord)){
+            break;
+        }
+        memcpy(&rec, trc + at, sizeof(tracerecord));
+        at += sizeof(tracerecord);
+        if(rec.flags & TRACE_HASHED){
+            at += sizeof(uint64_t);
+        }
+        if(rec.op >= NTRACEOPS || rec.pathlen >= PATH_MAX || at > size || size - at < rec.pathlen){
+            break;
+        }
+        memcpy(path, trc + at, rec.pathlen);
+        path[rec.pathlen] = '\0';
+        at += rec.pathlen;
+
+        if(rec.flags & TRACE_FAILED){
+            tracefailed++;
+        }
+        if(nops++ == 0){
+            firststart = rec.start;
+        }
+        if(timed && rec.start > firststart){
+            uint64_t due = (rec.start - firststart) * 1000;
+            clock_gettime(CLOCK_MONOTONIC, &before);
+            uint64_t now = elapsed(&began, &before);
+            if(due > now){
+                struct timespec wait = {(due - now) / 1000000000, (due - now) % 1000000000};
+                while(nanosleep(&wait, &wait) != 0 && errno == EINTR){
+                }
+            }
+        }
+
+        opstats *s = &stats[rec.op];
+        clock_gettime(CLOCK_MONOTONIC, &before);
+        int err = replayop(fsname, &rec, path, data);
+        clock_gettime(CLOCK_MONOTONIC, &after);
+        if(err == 1){
+            s->skipped++;
+            continue;
+        }
+        if(err < 0){
+            s->failed++;
+        }
+        s->latency[s->count++] = elapsed(&before, &after);
+        s->traced += rec.duration;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    if(at < size){
+        fprintf(stderr, "Warning: %s is damaged after %d records\n", tracefile, nops);
+    }
+
+    printf("%-10s %6s %6s %7s %10s %10s %10s %10s %10s\n", "op", "count", "failed",
+           "skipped", "min us", "p50 us", "p99 us", "max us", "traced avg");
+    for(int op = 0; op < NTRACEOPS; op++){
+        opstats *s = &stats[op];
+        if(s->count > 0){
+            qsort(s->latency, s->count, sizeof(uint64_t), comparelatency);
+            printf("%-10s %6d %6d %7d %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                   traceops[op].name, s->count, s->failed, s->skipped,
+                   s->latency[0] / 1000.0,
+                   percentile(s->latency, s->count, 50) / 1000.0,
+                   percentile(s->latency, s->count, 99) / 1000.0,
+                   s->latency[s->count - 1] / 1000.0,
+                   (double)s->traced / s->count);
+        }
+        else if(s->skipped > 0){
+            printf("%-10s %6d %6s %7d\n", traceops[op].name, 0, "", s->skipped);
+        }
+        free(s->latency);
+    }
+    printf("%s: %d ops replayed in %.3f s, %d had failed when traced\n", tracefile, nops,
+           elapsed(&began, &after) / 1e9, tracefailed);
+    free(trc);
+    free(data);
+    return 0;
+}